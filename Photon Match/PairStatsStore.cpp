@@ -0,0 +1,496 @@
+/*
+This file is part of Photon Match.
+	Photon Match is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photon Match is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photon Match.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "PairStatsStore.h"
+#include <QDebug>
+#include <QDateTime>
+#include <algorithm>
+#include <cstring>
+#ifdef Q_OS_WIN
+#include <windows.h>
+#else
+#include <cstdio>
+#endif
+
+PairStatsStore::PairStatsStore(const QString &storeDirPath)
+	: storeDir(storeDirPath)
+{
+	if (!storeDir.exists())
+		storeDir.mkpath(".");
+
+	// The snapshot is only ever swapped in by one atomic replace, and the old journal is removed after that,
+	// so a leftover tmp file always has its journal still on disk to merge again. The only tmp worth keeping
+	// is a complete one from a first-ever compaction that never got swapped in; anything else is dropped.
+	if (QFile::exists(snapshotTmpPath()))
+	{
+		if (QFile::exists(snapshotPath()) ||
+			!snapshotFileComplete(snapshotTmpPath()) ||
+			!replaceFile(snapshotTmpPath(), snapshotPath()))
+		{
+			QFile::remove(snapshotTmpPath());
+		}
+	}
+
+	mapSnapshot();
+
+	// Journals with a generation the snapshot already covers were merged before a crash, so they're dropped.
+	bool oldJournalPending = false;
+	quint32 newestGeneration = snapshotGeneration;
+	if (QFile::exists(journalOldPath()))
+	{
+		quint32 oldGeneration = 0;
+		int oldRecordCount = 0;
+		if (readJournal(journalOldPath(), oldGeneration, compactingOverlay, oldRecordCount) && oldGeneration > snapshotGeneration)
+		{
+			newestGeneration = oldGeneration;
+			oldJournalPending = true;
+		}
+		else
+		{
+			compactingOverlay.clear();
+			QFile::remove(journalOldPath());
+		}
+	}
+
+	quint32 liveGeneration = 0;
+	if (QFile::exists(journalPath()) &&
+		readJournal(journalPath(), liveGeneration, liveOverlay, journalRecordCount) &&
+		liveGeneration > newestGeneration)
+	{
+		journalGeneration = liveGeneration;
+	}
+	else
+	{
+		liveOverlay.clear();
+		journalRecordCount = 0;
+		journalGeneration = newestGeneration + 1;
+		QFile::remove(journalPath());
+	}
+
+	if (!openJournal(journalGeneration))
+		qDebug() << "Pair stats journal could not be opened: " + journalPath();
+
+	// Fold whatever the last session left in the journal into the snapshot while this one gets going.
+	if (oldJournalPending)
+		launchCompactionThread();
+	else if (journalRecordCount > 0)
+		startCompaction();
+}
+
+PairStatsStore::~PairStatsStore()
+{
+	if (compactionThread.joinable())
+		finishCompaction();
+	journalFile.close();
+	unmapSnapshot();
+}
+
+void PairStatsStore::recordAttempt(const quint64 pairId, const bool mismatched)
+{
+	if (compactionDone.load())
+		finishCompaction();
+
+	const PairStats delta{ pairId, 1, mismatched ? 1u : 0u, QDateTime::currentSecsSinceEpoch() };
+	if (journalFile.isOpen())
+		journalFile.write(reinterpret_cast<const char*>(&delta), sizeof(delta));
+	mergeInto(liveOverlay, delta);
+	journalRecordCount++;
+
+	if (journalRecordCount >= compactThreshold && !compactionThread.joinable() && !compactionBlocked)
+		startCompaction();
+}
+
+PairStatsStore::PairStats PairStatsStore::lookup(const quint64 pairId) const
+{
+	PairStats stats{ pairId, 0, 0, 0 };
+
+	const PairStats *snapshotEnd = snapshotRecords + snapshotCount;
+	const PairStats *found = std::lower_bound(snapshotRecords, snapshotEnd, pairId,
+		[](const PairStats &record, const quint64 id) { return record.pairId < id; });
+	if (found != snapshotEnd && found->pairId == pairId)
+		stats = *found;
+
+	const auto compacting = compactingOverlay.constFind(pairId);
+	if (compacting != compactingOverlay.constEnd())
+		accumulate(stats, compacting.value());
+
+	const auto live = liveOverlay.constFind(pairId);
+	if (live != liveOverlay.constEnd())
+		accumulate(stats, live.value());
+
+	return stats;
+}
+
+quint64 PairStatsStore::pairIdFromKey(const QString &key)
+{
+	// FNV-1a rather than qHash, since qHash is seeded per process and IDs have to stay put on disk.
+	quint64 hash = 14695981039346656037ULL;
+	for (const QChar ch : key)
+	{
+		hash ^= ch.unicode();
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+quint32 PairStatsStore::priorityWeight(const PairStats &stats, const qint64 nowSecs)
+{
+	// Pairs never seen sit in the middle. Ones the learner keeps missing rise above them,
+	// reliably matched ones sink below, and anything left alone for a while drifts back up.
+	const quint32 missRateWeight = (64 * (stats.mismatches + 1)) / (stats.attempts + 2);
+	quint32 stalenessWeight = 0;
+	if (stats.attempts > 0)
+	{
+		const qint64 daysUnseen = (nowSecs - stats.lastSeenSecs) / 86400;
+		stalenessWeight = static_cast<quint32>(std::max<qint64>(0, std::min<qint64>(daysUnseen, 30)));
+	}
+	return 16 + missRateWeight + stalenessWeight;
+}
+
+bool PairStatsStore::snapshotHeaderValid(const SnapshotHeader &header)
+{
+	return std::memcmp(header.magic, "PMPS", 4) == 0 &&
+		header.version == 1 &&
+		header.recordSize == sizeof(PairStats);
+}
+
+void PairStatsStore::accumulate(PairStats &into, const PairStats &delta)
+{
+	into.attempts += delta.attempts;
+	into.mismatches += delta.mismatches;
+	into.lastSeenSecs = std::max(into.lastSeenSecs, delta.lastSeenSecs);
+}
+
+bool PairStatsStore::snapshotFileComplete(const QString &filePath)
+{
+	QFile fileRead(filePath);
+	if (!fileRead.open(QIODevice::ReadOnly))
+		return false;
+
+	// The header (count included) is written before the records, so a crash mid-write leaves the file short.
+	SnapshotHeader header;
+	const qint64 fileSize = fileRead.size();
+	const bool complete =
+		fileRead.read(reinterpret_cast<char*>(&header), sizeof(header)) == sizeof(header) &&
+		snapshotHeaderValid(header) &&
+		header.count <= static_cast<quint64>(fileSize) / sizeof(PairStats) &&
+		fileSize == static_cast<qint64>(sizeof(SnapshotHeader) + header.count * sizeof(PairStats));
+	fileRead.close();
+	return complete;
+}
+
+bool PairStatsStore::replaceFile(const QString &fromPath, const QString &toPath)
+{
+	// One step that either fully replaces the target or leaves it alone.
+	// QFile::rename refuses to overwrite, which would need a remove first and leave a window with no snapshot.
+#ifdef Q_OS_WIN
+	return MoveFileExW(reinterpret_cast<const wchar_t*>(QDir::toNativeSeparators(fromPath).utf16()),
+		reinterpret_cast<const wchar_t*>(QDir::toNativeSeparators(toPath).utf16()),
+		MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	return std::rename(QFile::encodeName(fromPath).constData(), QFile::encodeName(toPath).constData()) == 0;
+#endif
+}
+
+void PairStatsStore::mapSnapshot()
+{
+	snapshotFile.setFileName(snapshotPath());
+	if (!snapshotFile.open(QIODevice::ReadOnly))
+		return;
+
+	const qint64 fileSize = snapshotFile.size();
+	if (fileSize >= static_cast<qint64>(sizeof(SnapshotHeader)))
+		snapshotMapping = snapshotFile.map(0, fileSize);
+
+	if (snapshotMapping == nullptr)
+	{
+		snapshotFile.close();
+		return;
+	}
+
+	const SnapshotHeader *header = reinterpret_cast<const SnapshotHeader*>(snapshotMapping);
+	if (!snapshotHeaderValid(*header))
+	{
+		unmapSnapshot();
+		return;
+	}
+
+	// Trust the file size over the header count, in case the file got cut short.
+	const quint64 recordsInFile = static_cast<quint64>(fileSize - sizeof(SnapshotHeader)) / sizeof(PairStats);
+	snapshotRecords = reinterpret_cast<const PairStats*>(snapshotMapping + sizeof(SnapshotHeader));
+	snapshotCount = std::min(header->count, recordsInFile);
+	snapshotGeneration = header->generation;
+}
+
+void PairStatsStore::unmapSnapshot()
+{
+	if (snapshotMapping != nullptr)
+		snapshotFile.unmap(snapshotMapping);
+	snapshotFile.close();
+	snapshotMapping = nullptr;
+	snapshotRecords = nullptr;
+	snapshotCount = 0;
+}
+
+bool PairStatsStore::openJournal(const quint32 generation)
+{
+	journalFile.setFileName(journalPath());
+	if (!journalFile.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Unbuffered))
+		return false;
+
+	if (journalFile.size() == 0)
+	{
+		JournalHeader header;
+		std::memcpy(header.magic, "PMPJ", 4);
+		header.version = 1;
+		header.generation = generation;
+		header.reserved = 0;
+		journalFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	}
+	else
+	{
+		// Drop a torn record left by a crash mid-write, so new appends stay aligned.
+		const qint64 recordBytes = journalFile.size() - static_cast<qint64>(sizeof(JournalHeader));
+		const qint64 alignedSize = sizeof(JournalHeader) + (recordBytes / sizeof(PairStats)) * sizeof(PairStats);
+		if (alignedSize != journalFile.size())
+			journalFile.resize(alignedSize);
+	}
+	return true;
+}
+
+bool PairStatsStore::readJournal(const QString &filePath, quint32 &generationOut, QHash<quint64, PairStats> &overlayOut, int &recordCountOut)
+{
+	QFile fileRead(filePath);
+	if (!fileRead.open(QIODevice::ReadOnly))
+		return false;
+
+	JournalHeader header;
+	if (fileRead.read(reinterpret_cast<char*>(&header), sizeof(header)) != sizeof(header) ||
+		std::memcmp(header.magic, "PMPJ", 4) != 0 ||
+		header.version != 1)
+	{
+		fileRead.close();
+		return false;
+	}
+
+	generationOut = header.generation;
+	recordCountOut = 0;
+	PairStats delta;
+	while (fileRead.read(reinterpret_cast<char*>(&delta), sizeof(delta)) == sizeof(delta))
+	{
+		mergeInto(overlayOut, delta);
+		recordCountOut++;
+	}
+	fileRead.close();
+	return true;
+}
+
+void PairStatsStore::mergeInto(QHash<quint64, PairStats> &overlay, const PairStats &delta)
+{
+	auto found = overlay.find(delta.pairId);
+	if (found == overlay.end())
+		overlay.insert(delta.pairId, delta);
+	else
+		accumulate(found.value(), delta);
+}
+
+void PairStatsStore::startCompaction()
+{
+	journalFile.close();
+	if (!QFile::rename(journalPath(), journalOldPath()))
+	{
+		// Don't retry on every update after this, that would close and reopen the journal per flip.
+		qDebug() << "Pair stats journal could not be rotated for compaction.";
+		openJournal(journalGeneration);
+		compactionBlocked = true;
+		return;
+	}
+
+	// Everything in the renamed journal is now the compacting overlay, and new updates start a fresh journal.
+	compactingOverlay.swap(liveOverlay);
+	journalRecordCount = 0;
+	journalGeneration++;
+	openJournal(journalGeneration);
+
+	launchCompactionThread();
+}
+
+void PairStatsStore::launchCompactionThread()
+{
+	compactionDone.store(false);
+	const QString snapshot = snapshotPath();
+	const QString journalOld = journalOldPath();
+	const QString tmp = snapshotTmpPath();
+	compactionThread = std::thread([this, snapshot, journalOld, tmp]() {
+		compactionSucceeded.store(writeCompactedSnapshot(snapshot, journalOld, tmp));
+		compactionDone.store(true);
+	});
+}
+
+void PairStatsStore::finishCompaction()
+{
+	compactionThread.join();
+	compactionDone.store(false);
+
+	if (!compactionSucceeded.load())
+	{
+		// Leave the old journal and the overlay where they are, the next startup will try again.
+		qDebug() << "Pair stats compaction failed.";
+		QFile::remove(snapshotTmpPath());
+		compactionBlocked = true;
+		return;
+	}
+
+	unmapSnapshot();
+	if (!replaceFile(snapshotTmpPath(), snapshotPath()))
+	{
+		// The replace is all-or-nothing, so the old snapshot is untouched and the overlay still covers
+		// the old journal. Reads stay correct, and the next startup merges that journal again.
+		qDebug() << "Pair stats snapshot could not be replaced.";
+		QFile::remove(snapshotTmpPath());
+		mapSnapshot();
+		compactionBlocked = true;
+		return;
+	}
+
+	QFile::remove(journalOldPath());
+	compactingOverlay.clear();
+	mapSnapshot();
+}
+
+bool PairStatsStore::writeCompactedSnapshot(const QString &snapshotPath, const QString &journalOldPath, const QString &tmpPath)
+{
+	// Runs on the compaction thread, so it only touches files and locals.
+	std::vector<PairStats> records;
+	QFile snapshotRead(snapshotPath);
+	if (snapshotRead.open(QIODevice::ReadOnly))
+	{
+		SnapshotHeader header;
+		if (snapshotRead.read(reinterpret_cast<char*>(&header), sizeof(header)) == sizeof(header) && snapshotHeaderValid(header))
+		{
+			// Same as mapSnapshot: trust the file size over the header count, and keep whatever could be read.
+			const quint64 recordsInFile = static_cast<quint64>(snapshotRead.size() - sizeof(SnapshotHeader)) / sizeof(PairStats);
+			records.resize(static_cast<size_t>(std::min(header.count, recordsInFile)));
+			const qint64 bytesRead = snapshotRead.read(reinterpret_cast<char*>(records.data()), static_cast<qint64>(records.size() * sizeof(PairStats)));
+			records.resize(bytesRead > 0 ? static_cast<size_t>(bytesRead) / sizeof(PairStats) : 0);
+		}
+		snapshotRead.close();
+	}
+
+	quint32 generation = 0;
+	int journalRecordCount = 0;
+	QHash<quint64, PairStats> journalOverlay;
+	if (!readJournal(journalOldPath, generation, journalOverlay, journalRecordCount))
+		return false;
+
+	for (auto &record : records)
+	{
+		auto found = journalOverlay.find(record.pairId);
+		if (found != journalOverlay.end())
+		{
+			accumulate(record, found.value());
+			journalOverlay.erase(found);
+		}
+	}
+	for (const auto &delta : journalOverlay)
+		records.push_back(delta);
+	std::sort(records.begin(), records.end(), [](const PairStats &a, const PairStats &b) {
+		return a.pairId < b.pairId;
+	});
+
+	QFile fileWrite(tmpPath);
+	if (!fileWrite.open(QIODevice::WriteOnly | QIODevice::Truncate))
+		return false;
+
+	SnapshotHeader header;
+	std::memcpy(header.magic, "PMPS", 4);
+	header.version = 1;
+	header.recordSize = sizeof(PairStats);
+	header.generation = generation;
+	header.count = records.size();
+	const qint64 recordBytes = static_cast<qint64>(records.size() * sizeof(PairStats));
+	const bool written =
+		fileWrite.write(reinterpret_cast<const char*>(&header), sizeof(header)) == sizeof(header) &&
+		fileWrite.write(reinterpret_cast<const char*>(records.data()), recordBytes) == recordBytes;
+	fileWrite.close();
+	return written;
+}
+
+void PairPicker::build(const std::vector<quint32> &newWeights)
+{
+	weights = newWeights;
+	tree.assign(weights.size() + 1, 0);
+	totalWeight = 0;
+
+	// O(n) construction: each node hands its running total up to its parent.
+	for (size_t i = 1; i < tree.size(); i++)
+	{
+		tree[i] += weights[i - 1];
+		totalWeight += weights[i - 1];
+		const size_t parent = i + (i & (~i + 1));
+		if (parent < tree.size())
+			tree[parent] += tree[i];
+	}
+}
+
+void PairPicker::update(const int index, const quint32 weight)
+{
+	const qint64 delta = static_cast<qint64>(weight) - static_cast<qint64>(weights[index]);
+	weights[index] = weight;
+	add(index, delta);
+}
+
+std::vector<int> PairPicker::pickWithoutReplacement(const int count, std::default_random_engine &rng)
+{
+	std::vector<int> picked;
+	for (int n = 0; n < count && totalWeight > 0; n++)
+	{
+		std::uniform_int_distribution<quint64> dist(0, totalWeight - 1);
+		const int index = findByPrefix(dist(rng));
+		picked.push_back(index);
+		add(index, -static_cast<qint64>(weights[index])); // out of the draw until every pick is made
+	}
+
+	for (const int index : picked)
+		add(index, weights[index]);
+
+	return picked;
+}
+
+void PairPicker::add(const int index, const qint64 delta)
+{
+	// Unsigned wraparound gives the right result for negative deltas, since no total ever goes below zero.
+	totalWeight += static_cast<quint64>(delta);
+	for (size_t i = static_cast<size_t>(index) + 1; i < tree.size(); i += i & (~i + 1))
+		tree[i] += static_cast<quint64>(delta);
+}
+
+int PairPicker::findByPrefix(quint64 target) const
+{
+	// Walk down from the largest power of two, keeping the longest prefix whose total is still <= target.
+	size_t step = 1;
+	while (step * 2 < tree.size())
+		step *= 2;
+
+	size_t pos = 0;
+	for (; step > 0; step /= 2)
+	{
+		if (pos + step < tree.size() && tree[pos + step] <= target)
+		{
+			pos += step;
+			target -= tree[pos];
+		}
+	}
+	return static_cast<int>(pos); // 1-indexed pos is the last element before target, so the 0-based answer is pos
+}
@@ -0,0 +1,128 @@
+/*
+This file is part of Photon Match.
+	Photon Match is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photon Match is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photon Match.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <QString>
+#include <QFile>
+#include <QDir>
+#include <QHash>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <random>
+
+// Per word pair learning history, kept across sessions.
+// Updates are appended to a journal file, reads come from a memory-mapped sorted snapshot
+// plus whatever is still sitting in the journal. Once the journal grows past a threshold
+// it's merged into a new snapshot on a background thread.
+class PairStatsStore
+{
+public:
+	struct PairStats
+	{
+		quint64 pairId;
+		quint32 attempts;
+		quint32 mismatches;
+		qint64 lastSeenSecs; // seconds since epoch
+	};
+	static_assert(sizeof(PairStats) == 24, "PairStatsStore::PairStats must stay fixed-size on disk.");
+
+	PairStatsStore(const QString &storeDirPath);
+	~PairStatsStore();
+
+	void recordAttempt(const quint64 pairId, const bool mismatched);
+	PairStats lookup(const quint64 pairId) const;
+
+	static quint64 pairIdFromKey(const QString &key);
+	static quint32 priorityWeight(const PairStats &stats, const qint64 nowSecs);
+
+private:
+	struct SnapshotHeader
+	{
+		char magic[4];
+		quint32 version;
+		quint32 recordSize;
+		quint32 generation; // the newest journal generation merged into this snapshot
+		quint64 count;
+	};
+
+	struct JournalHeader
+	{
+		char magic[4];
+		quint32 version;
+		quint32 generation;
+		quint32 reserved;
+	};
+
+	static const int compactThreshold = 1024; // journal records before a background compaction kicks off
+
+	const QDir storeDir;
+
+	QFile snapshotFile;
+	uchar *snapshotMapping = nullptr;
+	const PairStats *snapshotRecords = nullptr;
+	quint64 snapshotCount = 0;
+	quint32 snapshotGeneration = 0;
+
+	QFile journalFile;
+	quint32 journalGeneration = 0;
+	int journalRecordCount = 0;
+
+	// Changes not in the mapped snapshot yet: ones being compacted right now, and ones since.
+	QHash<quint64, PairStats> compactingOverlay;
+	QHash<quint64, PairStats> liveOverlay;
+
+	std::thread compactionThread;
+	std::atomic<bool> compactionDone{ false };
+	std::atomic<bool> compactionSucceeded{ false };
+	bool compactionBlocked = false; // set after a failed compaction or snapshot swap, the next startup retries
+
+	QString snapshotPath() const { return storeDir.filePath("pair-stats.dat"); }
+	QString snapshotTmpPath() const { return storeDir.filePath("pair-stats.dat.tmp"); }
+	QString journalPath() const { return storeDir.filePath("pair-stats.journal"); }
+	QString journalOldPath() const { return storeDir.filePath("pair-stats.journal.old"); }
+
+	static bool snapshotHeaderValid(const SnapshotHeader &header);
+	static void accumulate(PairStats &into, const PairStats &delta);
+	static bool snapshotFileComplete(const QString &filePath);
+	static bool replaceFile(const QString &fromPath, const QString &toPath);
+	void mapSnapshot();
+	void unmapSnapshot();
+	bool openJournal(const quint32 generation);
+	static bool readJournal(const QString &filePath, quint32 &generationOut, QHash<quint64, PairStats> &overlayOut, int &recordCountOut);
+	static void mergeInto(QHash<quint64, PairStats> &overlay, const PairStats &delta);
+	void startCompaction();
+	void launchCompactionThread();
+	void finishCompaction();
+	static bool writeCompactedSnapshot(const QString &snapshotPath, const QString &journalOldPath, const QString &tmpPath);
+};
+
+// Weighted random selection without replacement over one category's word pairs.
+// A Fenwick tree keeps running weight totals, so a single pick or weight update is O(log n).
+class PairPicker
+{
+public:
+	void build(const std::vector<quint32> &newWeights);
+	void update(const int index, const quint32 weight);
+	std::vector<int> pickWithoutReplacement(const int count, std::default_random_engine &rng);
+
+private:
+	std::vector<quint32> weights;
+	std::vector<quint64> tree; // 1-indexed
+	quint64 totalWeight = 0;
+
+	void add(const int index, const qint64 delta);
+	int findByPrefix(quint64 target) const;
+};
@@ -14,11 +14,17 @@ This file is part of Photon Match.
 
 #include "PhotonMatch.h"
 
-PhotonMatch::PhotonMatch(QWidget *parent)
-	: QMainWindow(parent)
+PhotonMatch::PhotonMatch(QWidget *parent, const bool replayMode)
+	: QMainWindow(parent), replayMode(replayMode)
 {
 	ui.setupUi(this);
 
+	if (!replayMode)
+	{
+		sessionLog = std::make_unique<SessionLog>(appExecutablePath + "/SessionLogs");
+		pairStats = std::make_unique<PairStatsStore>(appExecutablePath + "/PairStats");
+	}
+
 	ui.centralWidget->setLayout(baseLayout.get());
 	baseLayout.get()->setMargin(9);
 	baseLayout.get()->addLayout(flipCardLayout.get(), 0);
@@ -44,6 +50,7 @@ PhotonMatch::PhotonMatch(QWidget *parent)
 				connect(flipCardMap.at(i).btn.get(), &QPushButton::released, this, [=]() {
 					flipClickedCard(i);
 				});
+				flipCardMap.at(i).btn.get()->installEventFilter(this);
 				flipCardLayout.get()->addWidget(flipCardMap.at(i).btn.get(), row, col);
 				flipCardKeyList.emplace_back(i);
 				i++;
@@ -80,6 +87,7 @@ PhotonMatch::PhotonMatch(QWidget *parent)
 			currentCatIndex = randomCatIndex;
 			currentCatKey = catChoiceDisplayList[currentCatIndex];
 			qDebug() << "Random index is: " + QString::number(randomCatIndex);
+			recordEvent(SessionLog::EventType::CATEGORY_CHANGE, currentCatIndex, SessionLog::keyHash(currentLangKey + "_" + currentCatKey));
 		}
 		
 		if (populateFlipCardList())
@@ -145,6 +153,12 @@ PhotonMatch::PhotonMatch(QWidget *parent)
 					else
 						wordPair.append("NO IMG");
 
+					// Stable ID for learning stats, from the word IDs when the file has them, otherwise the words themselves.
+					const QString pairKey = (wordFirstId.isEmpty() || wordSecondId.isEmpty())
+						? wordPair[0] + "," + wordPair[1]
+						: wordFirstId + "_" + wordSecondId;
+					wordPair.append(QString::number(PairStatsStore::pairIdFromKey(dictEntryKey + "/" + pairKey)));
+
 					wordPair[0] = extractSubstringInbetweenQt("[/id]", "", wordPair[0]);
 					wordPair[1] = extractSubstringInbetweenQt("[/id]", "", wordPair[1]);
 					wordPair[0].replace(" ", "\n");
@@ -180,17 +194,68 @@ PhotonMatch::PhotonMatch(QWidget *parent)
 		currentCatKey = catChoiceDisplayList[currentCatIndex];
 	}
 
-	prefLoad();
+	if (!replayMode)
+		prefLoad();
+
+	// Baseline state for the session, so a replay doesn't depend on the preferences file.
+	recordEvent(SessionLog::EventType::LANGUAGE_CHANGE, currentLangIndex, SessionLog::keyHash(currentLangKey));
+	recordEvent(SessionLog::EventType::CATEGORY_CHANGE, currentCatIndex, SessionLog::keyHash(currentLangKey + "_" + currentCatKey));
+
+	flipResolveTimer.get()->setSingleShot(true);
+	connect(flipResolveTimer.get(), &QTimer::timeout, this, &PhotonMatch::resolveFlippedPair);
 
-	populateFlipCardList();
+	replayTimer.get()->setSingleShot(true);
+	connect(replayTimer.get(), &QTimer::timeout, this, &PhotonMatch::replayNextEvents);
+
+	// With no board to show, the blank cards would all "match" each other, so keep them out of play
+	// until a puzzle does get built.
+	if (!populateFlipCardList())
+	{
+		for (const auto &card : flipCardMap)
+			card.second.btn.get()->setEnabled(false);
+	}
 }
 
 void PhotonMatch::closeEvent(QCloseEvent *event)
 {
-	prefSave();
+	if (!replayMode)
+		prefSave();
 	event->accept();
 }
 
+bool PhotonMatch::eventFilter(QObject *watched, QEvent *event)
+{
+	// Click-to-visual-feedback latency: time from the click being handled to the flipped card's next paint.
+	if (event->type() == QEvent::Paint && flipFeedbackPendingIndex != -1 &&
+		watched == flipCardMap.at(flipFeedbackPendingIndex).btn.get())
+	{
+		const qint64 latencyUs = flipFeedbackClock.nsecsElapsed() / 1000;
+		recordEvent(SessionLog::EventType::FLIP_FEEDBACK, flipFeedbackPendingIndex, static_cast<qint32>(latencyUs));
+		flipFeedbackPendingIndex = -1;
+	}
+	return QMainWindow::eventFilter(watched, event);
+}
+
+bool PhotonMatch::startReplay(const QString &filePath)
+{
+	if (!SessionLog::readEvents(filePath, replayEvents))
+	{
+		QTextStream(stdout) << "Could not read session log (missing, or recorded by an incompatible version): " << filePath << endl;
+		return false;
+	}
+
+	for (const auto &event : replayEvents)
+	{
+		if (event.type == SessionLog::EventType::FLIP_RESOLVED)
+			replayExpectedResolutions.push_back(event);
+	}
+
+	QTextStream(stdout) << "Replaying " << replayEvents.size() << " events from " << filePath << endl;
+	replayClock.start();
+	replayTimer.get()->start(0);
+	return true;
+}
+
 void PhotonMatch::chooseLanguage()
 {
 	bool ok;
@@ -202,6 +267,7 @@ void PhotonMatch::chooseLanguage()
 		populateCatDisplayList();
 		currentCatIndex = 0;
 		currentCatKey = catChoiceDisplayList[currentCatIndex];
+		recordEvent(SessionLog::EventType::LANGUAGE_CHANGE, currentLangIndex, SessionLog::keyHash(currentLangKey));
 	}
 }
 
@@ -213,6 +279,7 @@ void PhotonMatch::chooseCategory()
 	{
 		currentCatKey = catChoice;
 		currentCatIndex = catChoiceDisplayList.indexOf(catChoice);
+		recordEvent(SessionLog::EventType::CATEGORY_CHANGE, currentCatIndex, SessionLog::keyHash(currentLangKey + "_" + currentCatKey));
 	}
 }
 
@@ -242,29 +309,67 @@ void PhotonMatch::chooseAudio()
 
 bool PhotonMatch::populateFlipCardList()
 {
-	puzzleCompleteSplash->hide();
-
-	flippedCount = 0;
-	flippedFirstIndex = -1;
-	solvedCount = 0;
+	return populateFlipCardListFromSeed(std::chrono::system_clock::now().time_since_epoch().count());
+}
 
+bool PhotonMatch::populateFlipCardListFromSeed(const unsigned int seed)
+{
+	// Both shuffles come from one recorded seed so a replay can rebuild the exact same board.
+	std::default_random_engine rng(seed);
+	const QString currentKeyToFind = currentLangKey + "_" + currentCatKey;
+
+	// Work out the whole new board before touching the current one,
+	// so if it can't be built the old board is left as it was and still playable.
+	std::vector<int> newFlipCardKeyList = flipCardKeyList;
+	std::vector<int> pairIndices;
 	if (!wordPairsMap.empty())
 	{
-		QString currentKeyToFind = currentLangKey + "_" + currentCatKey;
 		qDebug() << currentKeyToFind;
 		if (wordPairsMap.count(currentKeyToFind) == 0)
 			return false;
 
-		std::vector<QStringList> listInWordPairsMap = wordPairsMap.at(currentKeyToFind);
-		shuffleVecOfQStringList(listInWordPairsMap);
-
 		// We store a list of keys to the flip card map in a vector.
 		// To shuffle cards, we shuffle the list of keys and then we 
 		// apply from word pairs sequentially, using the list of keys sequentially.
 		// Since the list of keys has been shuffled, the order gets applied 
 		// shuffled, without needing to alter which key the flip card buttons are connected to.
 
-		shuffleFlipCardList();
+		shuffleFlipCardList(newFlipCardKeyList, rng);
+
+		// Pairs are drawn by learning priority instead of uniformly, so the ones a learner keeps missing come up more.
+		// This happens after the layout shuffle so a replay, which takes its pairs from the log, still gets the same layout.
+		if (!replayPairIndices.empty())
+			pairIndices.swap(replayPairIndices);
+		else
+			pairIndices = pairPickerFor(currentKeyToFind).pickWithoutReplacement(flipCardListSize / 2, rng);
+		if (static_cast<int>(pairIndices.size()) < flipCardListSize / 2)
+		{
+			qDebug() << "Not enough word pairs in " + currentKeyToFind + " to fill the board.";
+			return false;
+		}
+	}
+
+	puzzleCompleteSplash->hide();
+
+	// Drop any pair still waiting on the resolve delay, its indices mean nothing on the new board.
+	flipResolveTimer.get()->stop();
+	flipFeedbackPendingIndex = -1;
+
+	recordEvent(SessionLog::EventType::PUZZLE_SEED, static_cast<qint32>(seed), SessionLog::keyHash(currentKeyToFind));
+
+	flippedCount = 0;
+	flippedFirstIndex = -1;
+	flippedSecondIndex = -1;
+	solvedCount = 0;
+
+	if (!wordPairsMap.empty())
+	{
+		flipCardKeyList.swap(newFlipCardKeyList);
+		currentPuzzleKey = currentKeyToFind;
+
+		std::vector<QStringList> listInWordPairsMap;
+		for (const int pairIndex : pairIndices)
+			listInWordPairsMap.push_back(wordPairsMap.at(currentKeyToFind)[pairIndex]);
 
 		for (int i = 0; i < flipCardListSize / 2; i++)
 		{
@@ -272,6 +377,17 @@ bool PhotonMatch::populateFlipCardList()
 			int flipKey = flipCardKeyList[i];
 			int flipKeyMatch = flipCardKeyList[i + 10];
 
+			recordEvent(SessionLog::EventType::PUZZLE_PAIR, i, pairIndices[i]);
+			const quint64 pairId = listInWordPairsMap[i][5].toULongLong();
+			flipCardMap.at(flipKey).pairId = pairId;
+			flipCardMap.at(flipKey).pairIndex = pairIndices[i];
+			flipCardMap.at(flipKeyMatch).pairId = pairId;
+			flipCardMap.at(flipKeyMatch).pairIndex = pairIndices[i];
+			flipCardMap.at(flipKey).partnerIndex = flipKeyMatch;
+			flipCardMap.at(flipKeyMatch).partnerIndex = flipKey;
+			flipCardMap.at(flipKey).revealed = false;
+			flipCardMap.at(flipKeyMatch).revealed = false;
+
 			flipCardMap.at(flipKey).visState = flipCard::VisState::HIDDEN;
 			flipCardMap.at(flipKey).wordKey = listInWordPairsMap[i][0];
 			flipCardMap.at(flipKey).wordDisplay = listInWordPairsMap[i][0];
@@ -307,90 +423,114 @@ bool PhotonMatch::populateFlipCardList()
 
 void PhotonMatch::flipClickedCard(const int btnI)
 {
+	// Started before anything else so the latency includes resolving a pending pair on this click.
+	flipFeedbackClock.start();
+	recordEvent(SessionLog::EventType::FLIP_CLICK, btnI);
+
+	// A click while a pair is still showing doesn't wait out the delay,
+	// the pending pair gets resolved right away and this click carries on as a fresh flip.
+	if (flippedCount == maxFlipped)
+		resolveFlippedPair();
+
+	if (flipCardMap.at(btnI).visState != flipCard::VisState::HIDDEN)
+		return;
+
+	flipFeedbackPendingIndex = btnI;
+
+	flippedCount++;
+	if (!flipCardMap.at(btnI).bgImgPath.isEmpty() && flipCardMap.at(btnI).bgImgPath != "NO IMG")
+	{
+		flipCardMap.at(btnI).btn.get()->setStyleSheet(flipCardBtnFlippedImgStyleSheet
+			.arg(flipCardMap.at(btnI).bgImgPath));
+	}
+	else
+		flipCardMap.at(btnI).btn.get()->setStyleSheet(flipCardBtnFlippedStyleSheet);
+	flipCardMap.at(btnI).visState = flipCard::VisState::FLIPPED;
+	flipCardMap.at(btnI).revealed = true;
+	flipCardMap.at(btnI).btn.get()->setText(flipCardMap.at(btnI).wordDisplay);
+	if (!replayMode && (textToSpeechSetting == "ALL" ||
+		(textToSpeechSetting == "LEFT" && flipCardMap.at(btnI).soundLang == flipCard::SoundLang::LEFT) ||
+		(textToSpeechSetting == "RIGHT" && flipCardMap.at(btnI).soundLang == flipCard::SoundLang::RIGHT)))
+	{
+		if (!flipCardMap.at(btnI).soundPath.isEmpty() && flipCardMap.at(btnI).soundPath != "NO TTS")
+			QSound::play(flipCardMap.at(btnI).soundPath);
+		/*else
+			qDebug() << flipCardList[btnI].soundPath;*/
+	}
+
+	if (flippedCount == 1)
+	{
+		flippedFirstIndex = btnI;
+	}
+	else if (flippedCount == 2)
+	{
+		flippedSecondIndex = btnI;
+		flipResolveTimer.get()->start(flipResolveDelayMs);
+	}
+}
+
+void PhotonMatch::resolveFlippedPair()
+{
+	flipResolveTimer.get()->stop();
 	if (flippedCount < maxFlipped)
+		return;
+
+	if (flipCardMap.at(flippedFirstIndex).wordKey == flipCardMap.at(flippedSecondIndex).wordKey)
 	{
-		flippedCount++;
-		if (!flipCardMap.at(btnI).bgImgPath.isEmpty() && flipCardMap.at(btnI).bgImgPath != "NO IMG")
+		recordEvent(SessionLog::EventType::FLIP_RESOLVED, flippedFirstIndex, flippedSecondIndex, 1);
+		recordPairResult(flippedFirstIndex, false);
+
+		// match found, disable at both indices
+		flipCardMap.at(flippedFirstIndex).btn.get()->setEnabled(false);
+		flipCardMap.at(flippedSecondIndex).btn.get()->setEnabled(false);
+		flipCardMap.at(flippedFirstIndex).visState = flipCard::VisState::SOLVED;
+		flipCardMap.at(flippedSecondIndex).visState = flipCard::VisState::SOLVED;
+
+		if (!flipCardMap.at(flippedFirstIndex).bgImgPath.isEmpty() && flipCardMap.at(flippedFirstIndex).bgImgPath != "NO IMG")
 		{
-			flipCardMap.at(btnI).btn.get()->setStyleSheet(flipCardBtnFlippedImgStyleSheet
-				.arg(flipCardMap.at(btnI).bgImgPath));
+			flipCardMap.at(flippedFirstIndex).btn.get()->setStyleSheet(flipCardBtnSolvedImgStyleSheet
+				.arg(flipCardMap.at(flippedFirstIndex).bgImgPath));
 		}
 		else
-			flipCardMap.at(btnI).btn.get()->setStyleSheet(flipCardBtnFlippedStyleSheet);
-		flipCardMap.at(btnI).visState = flipCard::VisState::FLIPPED;
-		flipCardMap.at(btnI).btn.get()->setText(flipCardMap.at(btnI).wordDisplay);
-		if (textToSpeechSetting == "ALL" ||
-			(textToSpeechSetting == "LEFT" && flipCardMap.at(btnI).soundLang == flipCard::SoundLang::LEFT) ||
-			(textToSpeechSetting == "RIGHT" && flipCardMap.at(btnI).soundLang == flipCard::SoundLang::RIGHT))
+			flipCardMap.at(flippedFirstIndex).btn.get()->setStyleSheet(flipCardBtnSolvedStyleSheet);
+		if (!flipCardMap.at(flippedSecondIndex).bgImgPath.isEmpty() && flipCardMap.at(flippedSecondIndex).bgImgPath != "NO IMG")
 		{
-			if (!flipCardMap.at(btnI).soundPath.isEmpty() && flipCardMap.at(btnI).soundPath != "NO TTS")
-				QSound::play(flipCardMap.at(btnI).soundPath);
-			/*else
-				qDebug() << flipCardList[btnI].soundPath;*/
+			flipCardMap.at(flippedSecondIndex).btn.get()->setStyleSheet(flipCardBtnSolvedImgStyleSheet
+				.arg(flipCardMap.at(flippedSecondIndex).bgImgPath));
 		}
+		else
+			flipCardMap.at(flippedSecondIndex).btn.get()->setStyleSheet(flipCardBtnSolvedStyleSheet);
 
-		if (flippedCount == 1)
-		{
-			flippedFirstIndex = btnI;
-		}
-		else if (flippedCount == 2)
-		{
-			QTimer::singleShot(1000, this, [=](){
-				if (flipCardMap.at(flippedFirstIndex).wordKey == flipCardMap.at(btnI).wordKey &&
-					flippedFirstIndex != btnI)
-				{
-					// match found, disable at both indices
-					flipCardMap.at(flippedFirstIndex).btn.get()->setEnabled(false);
-					flipCardMap.at(btnI).btn.get()->setEnabled(false);
-					flipCardMap.at(flippedFirstIndex).visState = flipCard::VisState::SOLVED;
-					flipCardMap.at(btnI).visState = flipCard::VisState::SOLVED;
-
-					if (!flipCardMap.at(flippedFirstIndex).bgImgPath.isEmpty() && flipCardMap.at(flippedFirstIndex).bgImgPath != "NO IMG")
-					{
-						flipCardMap.at(flippedFirstIndex).btn.get()->setStyleSheet(flipCardBtnSolvedImgStyleSheet
-							.arg(flipCardMap.at(flippedFirstIndex).bgImgPath));
-					}
-					else
-						flipCardMap.at(flippedFirstIndex).btn.get()->setStyleSheet(flipCardBtnSolvedStyleSheet);
-					if (!flipCardMap.at(btnI).bgImgPath.isEmpty() && flipCardMap.at(btnI).bgImgPath != "NO IMG")
-					{
-						flipCardMap.at(btnI).btn.get()->setStyleSheet(flipCardBtnSolvedImgStyleSheet
-							.arg(flipCardMap.at(btnI).bgImgPath));
-					}
-					else
-						flipCardMap.at(btnI).btn.get()->setStyleSheet(flipCardBtnSolvedStyleSheet);
-
-					//flipCardMap.at(flippedFirstIndex).btn.get()->setStyleSheet(flipCardBtnSolvedStyleSheet);
-					//flipCardMap.at(btnI).btn.get()->setStyleSheet(flipCardBtnSolvedStyleSheet);
-
-					solvedCount++;
-					flippedCount = 0;
+		solvedCount++;
 
-					if (solvedCount == (flipCardListSize / 2))
-					{
-						// do puzzle is complete operations
-						// probably call another function to do this
-						qDebug("Puzzle complete!");
-						puzzleCompleteSplash->show();
-					}
-				}
-				else
-				{
-					// match not found, wait for a short period of time...
-					// then change cards back to hidden state...
-					// and reset flipped variables, like count and stored index
-					flipCardMap.at(flippedFirstIndex).visState = flipCard::VisState::HIDDEN;
-					flipCardMap.at(btnI).visState = flipCard::VisState::HIDDEN;
-					flipCardMap.at(flippedFirstIndex).btn.get()->setText("");
-					flipCardMap.at(btnI).btn.get()->setText("");
-					flipCardMap.at(flippedFirstIndex).btn.get()->setStyleSheet(flipCardBtnStyleSheet);
-					flipCardMap.at(btnI).btn.get()->setStyleSheet(flipCardBtnStyleSheet);
-					flippedCount = 0;
-				}
-				//qDebug("Timer went off.");
-			});
+		if (solvedCount == (flipCardListSize / 2))
+		{
+			// do puzzle is complete operations
+			// probably call another function to do this
+			qDebug("Puzzle complete!");
+			recordEvent(SessionLog::EventType::PUZZLE_COMPLETE);
+			if (!replayMode)
+				puzzleCompleteSplash->show();
 		}
 	}
+	else
+	{
+		recordEvent(SessionLog::EventType::FLIP_RESOLVED, flippedFirstIndex, flippedSecondIndex, 0);
+		recordPairResult(flippedFirstIndex, true);
+		recordPairResult(flippedSecondIndex, true);
+
+		// match not found, change cards back to hidden state
+		flipCardMap.at(flippedFirstIndex).visState = flipCard::VisState::HIDDEN;
+		flipCardMap.at(flippedSecondIndex).visState = flipCard::VisState::HIDDEN;
+		flipCardMap.at(flippedFirstIndex).btn.get()->setText("");
+		flipCardMap.at(flippedSecondIndex).btn.get()->setText("");
+		flipCardMap.at(flippedFirstIndex).btn.get()->setStyleSheet(flipCardBtnStyleSheet);
+		flipCardMap.at(flippedSecondIndex).btn.get()->setStyleSheet(flipCardBtnStyleSheet);
+	}
+
+	flippedCount = 0;
+	flippedFirstIndex = -1;
+	flippedSecondIndex = -1;
 }
 
 void PhotonMatch::prefLoad()
@@ -459,16 +599,203 @@ void PhotonMatch::populateCatDisplayList()
 	catChoiceDisplayList = newCategoriesList;
 }
 
-void PhotonMatch::shuffleVecOfQStringList(std::vector<QStringList> &listToShuffle)
+void PhotonMatch::shuffleFlipCardList(std::vector<int> &keyList, std::default_random_engine &rng)
+{
+	shuffle(keyList.begin(), keyList.end(), rng);
+}
+
+PairPicker &PhotonMatch::pairPickerFor(const QString &wordPairsKey)
+{
+	// Built once per category, after that each pick or weight update is logarithmic in the category size.
+	if (pairPickerMap.count(wordPairsKey) == 0)
+	{
+		const qint64 nowSecs = QDateTime::currentSecsSinceEpoch();
+		std::vector<quint32> weights;
+		for (const auto &wordPair : wordPairsMap.at(wordPairsKey))
+		{
+			if (pairStats)
+				weights.push_back(PairStatsStore::priorityWeight(pairStats.get()->lookup(wordPair[5].toULongLong()), nowSecs));
+			else
+				weights.push_back(1);
+		}
+		pairPickerMap[wordPairsKey].build(weights);
+	}
+	return pairPickerMap.at(wordPairsKey);
+}
+
+void PhotonMatch::recordPairResult(const int flipIndex, const bool mismatched)
+{
+	if (!pairStats || currentPuzzleKey.isEmpty())
+		return;
+
+	const flipCard &card = flipCardMap.at(flipIndex);
+	if (card.pairIndex < 0)
+		return;
+
+	// A mismatch only counts as a miss if the partner card had already been shown on this board,
+	// i.e. the learner had seen where it was and still didn't pair it. Otherwise it's just exploring.
+	if (mismatched && !flipCardMap.at(card.partnerIndex).revealed)
+		return;
+
+	pairStats.get()->recordAttempt(card.pairId, mismatched);
+	pairPickerFor(currentPuzzleKey).update(card.pairIndex,
+		PairStatsStore::priorityWeight(pairStats.get()->lookup(card.pairId), QDateTime::currentSecsSinceEpoch()));
+}
+
+void PhotonMatch::recordEvent(const SessionLog::EventType type, const qint32 a, const qint32 b, const qint32 c)
+{
+	if (sessionLog)
+		sessionLog.get()->record(type, a, b, c);
+
+	if (replayMode && type == SessionLog::EventType::FLIP_RESOLVED)
+	{
+		// Compare each resolution against what happened in the recorded session.
+		if (replayResolutionPos >= replayExpectedResolutions.size() ||
+			replayExpectedResolutions[replayResolutionPos].a != a ||
+			replayExpectedResolutions[replayResolutionPos].b != b ||
+			replayExpectedResolutions[replayResolutionPos].c != c)
+		{
+			replayDivergenceCount++;
+			qDebug() << "Replay diverged at resolution " + QString::number(replayResolutionPos);
+		}
+		replayResolutionPos++;
+	}
+}
+
+void PhotonMatch::replayNextEvents()
+{
+	if (replayFinishing)
+	{
+		finishReplay();
+		return;
+	}
+
+	// Apply everything that's due, then sleep until the next event's recorded timestamp.
+	const quint64 nowUs = static_cast<quint64>(replayClock.nsecsElapsed() / 1000);
+	while (replayEventPos < replayEvents.size() && replayEvents[replayEventPos].timestampUs <= nowUs)
+	{
+		if (!applyReplayEvent(replayEvents[replayEventPos]))
+		{
+			QTextStream(stdout) << "Replay aborted at event " << replayEventPos
+				<< ": session log was recorded with different word pair data." << endl;
+			QCoreApplication::exit(1);
+			return;
+		}
+		replayEventPos++;
+	}
+
+	if (replayEventPos < replayEvents.size())
+	{
+		const quint64 waitUs = replayEvents[replayEventPos].timestampUs - nowUs;
+		replayTimer.get()->start(static_cast<int>(waitUs / 1000));
+	}
+	else
+	{
+		replayFinishing = true;
+		replayTimer.get()->start(replayDrainMs);
+	}
+}
+
+bool PhotonMatch::applyReplayEvent(const SessionLog::Event &event)
 {
-	int seed = std::chrono::system_clock::now().time_since_epoch().count();
-	shuffle(listToShuffle.begin(), listToShuffle.end(), std::default_random_engine(seed));
+	switch (event.type)
+	{
+	case SessionLog::EventType::LANGUAGE_CHANGE:
+		if (event.a < 0 || event.a >= langChoiceDisplayList.length())
+			return false;
+		currentLangIndex = event.a;
+		currentLangKey = langChoiceDisplayList[currentLangIndex];
+		if (SessionLog::keyHash(currentLangKey) != event.b)
+			return false;
+		populateCatDisplayList();
+		currentCatIndex = 0;
+		currentCatKey = catChoiceDisplayList[currentCatIndex];
+		break;
+	case SessionLog::EventType::CATEGORY_CHANGE:
+		if (event.a < 0 || event.a >= catChoiceDisplayList.length())
+			return false;
+		currentCatIndex = event.a;
+		currentCatKey = catChoiceDisplayList[currentCatIndex];
+		if (SessionLog::keyHash(currentLangKey + "_" + currentCatKey) != event.b)
+			return false;
+		break;
+	case SessionLog::EventType::PUZZLE_SEED:
+	{
+		// The pairs that were picked follow the seed in the log, take them instead of re-picking against today's stats.
+		const QString wordPairsKey = currentLangKey + "_" + currentCatKey;
+		if (SessionLog::keyHash(wordPairsKey) != event.b)
+			return false;
+		replayPairIndices.clear();
+		for (size_t i = replayEventPos + 1; i < replayEvents.size() && replayEvents[i].type == SessionLog::EventType::PUZZLE_PAIR; i++)
+		{
+			if (wordPairsMap.count(wordPairsKey) == 0 ||
+				replayEvents[i].b < 0 || replayEvents[i].b >= static_cast<qint32>(wordPairsMap.at(wordPairsKey).size()))
+				return false;
+			replayPairIndices.push_back(replayEvents[i].b);
+		}
+		if (!replayPairIndices.empty() && static_cast<int>(replayPairIndices.size()) != flipCardListSize / 2)
+			return false;
+		const bool populated = populateFlipCardListFromSeed(static_cast<unsigned int>(event.a));
+		replayPairIndices.clear();
+		if (!populated)
+			return false;
+		break;
+	}
+	case SessionLog::EventType::FLIP_CLICK:
+	{
+		if (flipCardMap.count(event.a) == 0)
+			return false;
+		QElapsedTimer flipTimer;
+		flipTimer.start();
+		flipClickedCard(event.a);
+		const qint64 flipNs = flipTimer.nsecsElapsed();
+		replayFlipCount++;
+		replayFlipNsTotal += flipNs;
+		replayFlipNsMax = std::max(replayFlipNsMax, flipNs);
+		break;
+	}
+	default:
+		// Outcomes (resolutions, puzzle complete) are reproduced by the replay itself, not re-driven.
+		break;
+	}
+	return true;
 }
 
-void PhotonMatch::shuffleFlipCardList()
+void PhotonMatch::finishReplay()
 {
-	int seed = std::chrono::system_clock::now().time_since_epoch().count();
-	shuffle(flipCardKeyList.begin(), flipCardKeyList.end(), std::default_random_engine(seed));
+	QTextStream out(stdout);
+	out << "Replay finished in " << replayClock.elapsed() << " ms" << endl;
+	out << "Flip clicks: " << replayFlipCount << endl;
+	if (replayFlipCount > 0)
+	{
+		out << "Flip handler avg: " << (replayFlipNsTotal / replayFlipCount) / 1000 << " us, max: "
+			<< replayFlipNsMax / 1000 << " us" << endl;
+	}
+
+	// Feedback latency can't be measured headlessly (nothing gets painted), so report what was recorded.
+	int recordedFeedbackCount = 0;
+	qint64 recordedFeedbackUsTotal = 0;
+	qint64 recordedFeedbackUsMax = 0;
+	for (const auto &event : replayEvents)
+	{
+		if (event.type == SessionLog::EventType::FLIP_FEEDBACK)
+		{
+			recordedFeedbackCount++;
+			recordedFeedbackUsTotal += event.b;
+			recordedFeedbackUsMax = std::max<qint64>(recordedFeedbackUsMax, event.b);
+		}
+	}
+	if (recordedFeedbackCount > 0)
+	{
+		out << "Recorded click-to-feedback avg: " << recordedFeedbackUsTotal / recordedFeedbackCount << " us, max: "
+			<< recordedFeedbackUsMax << " us" << endl;
+	}
+
+	out << "Resolutions: " << replayResolutionPos << " replayed, " << replayExpectedResolutions.size() << " recorded" << endl;
+	if (replayResolutionPos != replayExpectedResolutions.size())
+		replayDivergenceCount++;
+	out << "Divergences: " << replayDivergenceCount << endl;
+	QCoreApplication::exit(replayDivergenceCount == 0 ? 0 : 2);
 }
 
 std::string PhotonMatch::extractSubstringInbetween(const std::string strBegin, const std::string strEnd, const std::string &strExtractFrom)
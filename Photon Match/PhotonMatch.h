@@ -32,6 +32,11 @@ This file is part of Photon Match.
 #include <QSettings>
 #include <QSound>
 #include <QTimer>
+#include <QElapsedTimer>
+#include <QTextStream>
+#include <QDateTime>
+#include "SessionLog.h"
+#include "PairStatsStore.h"
 #include <memory>
 #include <vector>
 #include <random>
@@ -43,8 +48,10 @@ class PhotonMatch : public QMainWindow
 	Q_OBJECT
 
 public:
-	PhotonMatch(QWidget *parent = Q_NULLPTR);
+	PhotonMatch(QWidget *parent = Q_NULLPTR, const bool replayMode = false);
 	void closeEvent(QCloseEvent *event);
+	bool eventFilter(QObject *watched, QEvent *event);
+	bool startReplay(const QString &filePath);
 
 private:
 	Ui::PhotonMatchClass ui;
@@ -114,6 +121,10 @@ private:
 		enum class SoundLang { LEFT, RIGHT, NONE };
 		SoundLang soundLang = SoundLang::NONE;
 		QString bgImgPath;
+		quint64 pairId = 0; // key into the pair stats store
+		int pairIndex = -1; // index of the word pair within its category
+		int partnerIndex = -1; // flip card index of the other half of the pair
+		bool revealed = false; // has been flipped at least once on this board
 	};
 
 	std::map<int, flipCard> flipCardMap;
@@ -124,6 +135,11 @@ private:
 	const int maxFlipped = 2; // The maximum number of "pieces" that can be in the flipped up state at the same time.
 	int flippedCount = 0;
 	int flippedFirstIndex = -1;
+	int flippedSecondIndex = -1;
+	const int flipResolveDelayMs = 1000; // How long a flipped pair stays up if the player doesn't click again first.
+	std::unique_ptr<QTimer> flipResolveTimer = std::make_unique<QTimer>();
+	QElapsedTimer flipFeedbackClock;
+	int flipFeedbackPendingIndex = -1;
 	const int flipCardListSize = 20;
 	const int flipRowLength = 4;
 	const int flipColLength = 5;
@@ -131,11 +147,38 @@ private:
 
 	std::unique_ptr<QSplashScreen> puzzleCompleteSplash = std::make_unique<QSplashScreen>();
 
+	std::unique_ptr<PairStatsStore> pairStats;
+	std::map<QString, PairPicker> pairPickerMap; // built lazily per category, keyed the same as wordPairsMap
+	QString currentPuzzleKey;
+
+	// In replay mode the window is never shown and events come from a recorded session log
+	// instead of the user, so nothing is written back (no session log, no preferences, no sound).
+	const bool replayMode;
+	std::unique_ptr<SessionLog> sessionLog;
+	std::vector<SessionLog::Event> replayEvents;
+	std::vector<SessionLog::Event> replayExpectedResolutions;
+	std::vector<int> replayPairIndices;
+	size_t replayEventPos = 0;
+	size_t replayResolutionPos = 0;
+	int replayDivergenceCount = 0;
+	int replayFlipCount = 0;
+	qint64 replayFlipNsTotal = 0;
+	qint64 replayFlipNsMax = 0;
+	bool replayFinishing = false;
+	QElapsedTimer replayClock;
+	std::unique_ptr<QTimer> replayTimer = std::make_unique<QTimer>();
+	const int replayDrainMs = 1500; // long enough for the last pending flip pair to resolve
+
 	void prefLoad();
 	void prefSave();
 	void populateCatDisplayList();
-	void shuffleVecOfQStringList(std::vector<QStringList> &listToShuffle);
-	void shuffleFlipCardList();
+	bool populateFlipCardListFromSeed(const unsigned int seed);
+	PairPicker &pairPickerFor(const QString &wordPairsKey);
+	void recordPairResult(const int flipIndex, const bool mismatched);
+	void shuffleFlipCardList(std::vector<int> &keyList, std::default_random_engine &rng);
+	void recordEvent(const SessionLog::EventType type, const qint32 a = 0, const qint32 b = 0, const qint32 c = 0);
+	bool applyReplayEvent(const SessionLog::Event &event);
+	void finishReplay();
 	std::string extractSubstringInbetween(const std::string strBegin, const std::string strEnd, const std::string &strExtractFrom);
 	QString extractSubstringInbetweenQt(const QString strBegin, const QString strEnd, const QString &strExtractFrom);
 
@@ -145,4 +188,6 @@ private slots:
 	void chooseAudio();
 	bool populateFlipCardList();
 	void flipClickedCard(const int btnI);
+	void resolveFlippedPair();
+	void replayNextEvents();
 };
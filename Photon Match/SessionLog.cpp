@@ -0,0 +1,189 @@
+/*
+This file is part of Photon Match.
+	Photon Match is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photon Match is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photon Match.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "SessionLog.h"
+#include <QDebug>
+#include <QDateTime>
+#include <QFileInfo>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+SessionLog::SessionLog(const QString &logDirPath)
+	: logDir(logDirPath)
+{
+	sessionClock.start();
+
+	if (!logDir.exists())
+		logDir.mkpath(".");
+
+	// Each session starts its own file, so the last session is always session.1.pmlog after a restart.
+	// Files are only rotated here and never mid-session: a file that starts partway through a session
+	// would have no baseline language/category/seed to replay from.
+	if (QFileInfo(logDir.filePath(currentLogFileName())).size() > 0)
+		rotateLogFiles();
+
+	if (openLogFile())
+		flushThread = std::thread(&SessionLog::flushLoop, this);
+	else
+		qDebug() << "Session log could not be opened: " + logDir.filePath(currentLogFileName());
+
+	const qint64 wallClockSecs = QDateTime::currentSecsSinceEpoch();
+	record(EventType::SESSION_START, static_cast<qint32>(wallClockSecs & 0xFFFFFFFF), static_cast<qint32>(wallClockSecs >> 32));
+}
+
+SessionLog::~SessionLog()
+{
+	if (flushThread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(flushMutex);
+			stopRequested = true;
+		}
+		flushWake.notify_one();
+		flushThread.join();
+	}
+
+	if (logFile.isOpen())
+	{
+		flushPending();
+		logFile.close();
+	}
+
+	if (droppedCount.load() > 0)
+		qDebug() << "Session log dropped " + QString::number(droppedCount.load()) + " events.";
+}
+
+void SessionLog::record(const EventType type, const qint32 a, const qint32 b, const qint32 c)
+{
+	// Single producer: only ever called from the GUI thread.
+	const quint64 head = ringHead.load(std::memory_order_relaxed);
+	const quint64 tail = ringTail.load(std::memory_order_acquire);
+	if (head - tail >= ringCapacity)
+	{
+		droppedCount.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	Event &event = ring[head & (ringCapacity - 1)];
+	event.timestampUs = static_cast<quint64>(sessionClock.nsecsElapsed() / 1000);
+	event.type = type;
+	event.a = a;
+	event.b = b;
+	event.c = c;
+	ringHead.store(head + 1, std::memory_order_release);
+
+	// Don't pay for a wake-up on every event; the flush thread polls on its own interval.
+	if (head - tail == ringCapacity / 2)
+		flushWake.notify_one();
+}
+
+qint32 SessionLog::keyHash(const QString &key)
+{
+	// 32-bit FNV-1a, stable across runs so a replay can tell the word pair data changed under an index.
+	quint32 hash = 2166136261u;
+	for (const QChar ch : key)
+	{
+		hash ^= ch.unicode();
+		hash *= 16777619u;
+	}
+	return static_cast<qint32>(hash);
+}
+
+bool SessionLog::readEvents(const QString &filePath, std::vector<Event> &eventsOut)
+{
+	QFile fileRead(filePath);
+	if (!fileRead.open(QIODevice::ReadOnly))
+		return false;
+
+	FileHeader header;
+	if (fileRead.read(reinterpret_cast<char*>(&header), sizeof(header)) != sizeof(header) ||
+		std::memcmp(header.magic, "PMSL", 4) != 0 ||
+		header.version != formatVersion ||
+		header.eventSize != sizeof(Event))
+	{
+		fileRead.close();
+		return false;
+	}
+
+	const qint64 eventCount = (fileRead.size() - static_cast<qint64>(sizeof(header))) / static_cast<qint64>(sizeof(Event));
+	eventsOut.resize(static_cast<size_t>(eventCount));
+	if (eventCount > 0)
+		fileRead.read(reinterpret_cast<char*>(eventsOut.data()), eventCount * sizeof(Event));
+	fileRead.close();
+	return true;
+}
+
+void SessionLog::flushLoop()
+{
+	std::unique_lock<std::mutex> lock(flushMutex);
+	while (!stopRequested)
+	{
+		flushWake.wait_for(lock, std::chrono::milliseconds(flushIntervalMs));
+		lock.unlock();
+		flushPending();
+		lock.lock();
+	}
+}
+
+void SessionLog::flushPending()
+{
+	const quint64 tail = ringTail.load(std::memory_order_relaxed);
+	const quint64 head = ringHead.load(std::memory_order_acquire);
+	if (head == tail)
+		return;
+
+	// The pending range can wrap around the end of the ring, in which case it's written in two chunks.
+	const quint64 first = tail & (ringCapacity - 1);
+	const quint64 count = head - tail;
+	const quint64 firstChunk = std::min<quint64>(count, ringCapacity - first);
+	logFile.write(reinterpret_cast<const char*>(&ring[first]), firstChunk * sizeof(Event));
+	if (count > firstChunk)
+		logFile.write(reinterpret_cast<const char*>(&ring[0]), (count - firstChunk) * sizeof(Event));
+	logFile.flush();
+
+	ringTail.store(head, std::memory_order_release);
+}
+
+bool SessionLog::openLogFile()
+{
+	logFile.setFileName(logDir.filePath(currentLogFileName()));
+	if (!logFile.open(QIODevice::WriteOnly | QIODevice::Truncate))
+		return false;
+
+	FileHeader header;
+	std::memcpy(header.magic, "PMSL", 4);
+	header.version = formatVersion;
+	header.eventSize = sizeof(Event);
+	header.reserved = 0;
+	logFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	return true;
+}
+
+void SessionLog::rotateLogFiles()
+{
+	// session.pmlog -> session.1.pmlog -> session.2.pmlog ... oldest one falls off the end.
+	QFile::remove(rotatedLogFilePath(maxRotatedFiles));
+	for (int n = maxRotatedFiles - 1; n >= 1; n--)
+	{
+		if (QFile::exists(rotatedLogFilePath(n)))
+			QFile::rename(rotatedLogFilePath(n), rotatedLogFilePath(n + 1));
+	}
+	QFile::rename(logDir.filePath(currentLogFileName()), rotatedLogFilePath(1));
+}
+
+QString SessionLog::rotatedLogFilePath(const int n) const
+{
+	return logDir.filePath("session." + QString::number(n) + ".pmlog");
+}
@@ -0,0 +1,102 @@
+/*
+This file is part of Photon Match.
+	Photon Match is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+	Photon Match is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	You should have received a copy of the GNU General Public License
+	along with Photon Match.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <QString>
+#include <QFile>
+#include <QDir>
+#include <QElapsedTimer>
+#include <array>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+// Always-on recorder for diagnosing field reports.
+// The GUI thread writes fixed-size events into a ring buffer (no locks, no allocation)
+// and a background thread flushes them to a rotating binary file in the log directory.
+class SessionLog
+{
+public:
+	enum class EventType : quint32
+	{
+		SESSION_START, // a = wall clock seconds (low 32 bits), b = wall clock seconds (high 32 bits)
+		PUZZLE_SEED, // a = shuffle seed used by populateFlipCardList, b = keyHash of the word pairs key ("Lang_Cat")
+		LANGUAGE_CHANGE, // a = language index, b = keyHash of the language name
+		CATEGORY_CHANGE, // a = category index, b = keyHash of the word pairs key ("Lang_Cat")
+		FLIP_CLICK, // a = flip card index
+		FLIP_RESOLVED, // a = first flip card index, b = second flip card index, c = 1 if matched
+		PUZZLE_COMPLETE,
+		FLIP_FEEDBACK, // a = flip card index, b = microseconds from click to the card's first repaint
+		PUZZLE_PAIR // a = pair slot on the board, b = index of the word pair within its category
+	};
+
+	struct Event
+	{
+		quint64 timestampUs; // microseconds since the session started
+		EventType type;
+		qint32 a;
+		qint32 b;
+		qint32 c;
+	};
+	static_assert(sizeof(Event) == 24, "SessionLog::Event must stay fixed-size on disk.");
+
+	SessionLog(const QString &logDirPath);
+	~SessionLog();
+
+	void record(const EventType type, const qint32 a = 0, const qint32 b = 0, const qint32 c = 0);
+
+	static QString currentLogFileName() { return "session.pmlog"; }
+	static qint32 keyHash(const QString &key);
+	static bool readEvents(const QString &filePath, std::vector<Event> &eventsOut);
+
+private:
+	struct FileHeader
+	{
+		char magic[4];
+		quint32 version;
+		quint32 eventSize;
+		quint32 reserved;
+	};
+
+	// Bump whenever events change meaning or the seed no longer rebuilds the same board.
+	// Version 2: pairs are picked by PairPicker after the layout shuffle and logged as PUZZLE_PAIR,
+	// and change/seed events carry a key hash.
+	static const quint32 formatVersion = 2;
+	static const int ringCapacity = 4096; // must be a power of two
+	static const int flushIntervalMs = 500;
+	static const int maxRotatedFiles = 3;
+
+	std::array<Event, ringCapacity> ring;
+	std::atomic<quint64> ringHead{ 0 }; // only advanced by the GUI thread
+	std::atomic<quint64> ringTail{ 0 }; // only advanced by the flush thread
+	std::atomic<quint64> droppedCount{ 0 };
+	QElapsedTimer sessionClock;
+
+	const QDir logDir;
+	QFile logFile;
+
+	std::thread flushThread;
+	std::mutex flushMutex;
+	std::condition_variable flushWake;
+	bool stopRequested = false;
+
+	void flushLoop();
+	void flushPending();
+	bool openLogFile();
+	void rotateLogFiles();
+	QString rotatedLogFilePath(const int n) const;
+};
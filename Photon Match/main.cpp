@@ -14,11 +14,37 @@ This file is part of Photon Match.
 
 #include "PhotonMatch.h"
 #include <QtWidgets/QApplication>
+#ifdef Q_OS_WIN
+#include <windows.h>
+#include <cstdio>
+#endif
 
 int main(int argc, char *argv[])
 {
 	QApplication a(argc, argv);
 	a.setWindowIcon(QIcon(":/PhotonMatch/Icon/photon-match-program-icon.ico"));
+
+	// "--replay <session log>" re-drives a recorded session headlessly and prints timing to stdout.
+	const QStringList args = a.arguments();
+	const int replayArgIndex = args.indexOf("--replay");
+	if (replayArgIndex != -1 && replayArgIndex + 1 < args.length())
+	{
+#ifdef Q_OS_WIN
+		// The app links as a Windows GUI program, so it has no console of its own.
+		// Borrow the one it was launched from, otherwise the replay report goes nowhere.
+		// If stdout was already redirected to a file or pipe, leave it alone.
+		if (GetFileType(GetStdHandle(STD_OUTPUT_HANDLE)) == FILE_TYPE_UNKNOWN && AttachConsole(ATTACH_PARENT_PROCESS))
+		{
+			freopen("CONOUT$", "w", stdout);
+			freopen("CONOUT$", "w", stderr);
+		}
+#endif
+		PhotonMatch replayer(Q_NULLPTR, true);
+		if (!replayer.startReplay(args[replayArgIndex + 1]))
+			return 1;
+		return a.exec();
+	}
+
 	PhotonMatch w;
 	w.show();
 	return a.exec();